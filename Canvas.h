@@ -1,18 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
-
-
+// an all zero ATOM (cnt == 0) is an empty pixel, so the canvas can be cleared with plain memset
 typedef struct
 {
-    double      hue;
-    double      sat;
-    double      brt;
-    uint8_t  run;
+    double   hue;
+    double   sat;
+    double   brt;
+    uint32_t run; // index into the nucleus table
     uint32_t cnt;
 } ATOM;
 
@@ -23,7 +27,7 @@ class Canvas
       : dsWidth(w)
       , dsHeight(h)
     {
-        ds.resize(width() * height());
+        ds.reset(new ATOM[pixels()]); // left uninitialized, first touch happens in clear()
         clear();
     }
 
@@ -39,38 +43,87 @@ class Canvas
         ds[p]  = atom;
     }
 
+    static bool isEmpty(const ATOM &atom)
+    {
+        return atom.cnt == 0;
+    }
+
     void getValues(int x, int y, ATOM &atom) const
     {
         int32_t p;
         if ((y < 0) || (x < 0) || (x >= width()) || (y >= height()))
-        {
+        { // outside counts as occupied
             atom.hue = 1.0;
             atom.sat = 1.0;
             atom.brt = 1.0;
-            atom.run = 0xFF;
-            atom.cnt = 0;
+            atom.run = 0xFFFFFFFF;
+            atom.cnt = 0xFFFFFFFF;
             return;
         }
         p    = x + y * width();
         atom = ds[p];
     }
 
-    void clear(void)
+    // bit n of the result is set if the pixel at (x, y) + dirs[n] is empty
+    template <typename D, size_t N>
+    uint32_t freeNeighbours(int x, int y, const D (&dirs)[N]) const
     {
-        int32_t p = 0;
-        for (int32_t y = 0; y < height(); y++)
-        {
-            for (int32_t x = 0; x < width(); x++)
+        uint32_t mask = 0;
+        if ((x > 0) && (y > 0) && (x < width() - 1) && (y < height() - 1))
+        { // inside: no bounds check per neighbour
+            const ATOM *center = &ds[x + y * width()];
+            for (size_t n = 0; n < N; ++n)
             {
-                ds[p].hue = NAN;
-                ds[p].sat = NAN;
-                ds[p].brt = NAN;
-                ds[p].run = 0xff;
-                ds[p].cnt = 0;
-                p++;
+                if (isEmpty(center[dirs[n].x + dirs[n].y * width()]))
+                    mask |= 1u << n;
             }
+            return mask;
+        }
+        ATOM atom;
+        for (size_t n = 0; n < N; ++n)
+        {
+            getValues(x + dirs[n].x, y + dirs[n].y, atom);
+            if (isEmpty(atom))
+                mask |= 1u << n;
+        }
+        return mask;
+    }
+
+    void clear(void)
+    {
+        // every thread zeroes its own slice of rows, so pages are first touched (and placed) by the workers
+        const size_t minPixelsPerThread = 1 << 20;
+        size_t       threads            = std::thread::hardware_concurrency();
+        if (threads > pixels() / minPixelsPerThread)
+            threads = pixels() / minPixelsPerThread;
+        if (threads < 2)
+        {
+            memset(ds.get(), 0, pixels() * sizeof(ATOM));
+            return;
+        }
+        std::vector<std::thread> workers;
+        const size_t             rowsPerThread = (height() + threads - 1) / threads;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            const size_t y0 = t * rowsPerThread;
+            const size_t y1 = std::min(y0 + rowsPerThread, static_cast<size_t>(height()));
+            if (y0 >= y1)
+                break;
+            ATOM  *start = ds.get() + y0 * width();
+            size_t bytes = (y1 - y0) * width() * sizeof(ATOM);
+            workers.emplace_back([start, bytes]() { memset(start, 0, bytes); });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
         }
     }
+
+    size_t pixels() const
+    {
+        return static_cast<size_t>(dsWidth) * dsHeight;
+    }
+
     int32_t width() const
     {
         return dsWidth;
@@ -147,14 +200,17 @@ class Canvas
     {
         FILE *fp;
         fp = fopen(filename.c_str(), "wb");
-        uint32_t maxCnt[256];
-        memset(maxCnt, 0, sizeof(maxCnt));
+        std::vector<uint32_t> maxCnt(10);
         printf("saving %d x %d\n", width(), height());
         for (int y = 0; y < height(); y++)
         {
             int32_t  p=y*width();
             for (int x = 0; x < width(); ++x, ++p)
             {
+                if (ds[p].run >= maxCnt.size())
+                {
+                    maxCnt.resize(ds[p].run + 1);
+                }
                 if (ds[p].cnt > maxCnt[ds[p].run])
                 {
                     maxCnt[ds[p].run] = ds[p].cnt;
@@ -174,7 +230,7 @@ class Canvas
     }
 
   private:
-    std::vector<ATOM> ds;
+    std::unique_ptr<ATOM[]> ds;
     int32_t dsWidth;
     int32_t dsHeight;
 };
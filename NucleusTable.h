@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// per nucleus parameters as structure of arrays, the index is the run id stored in ATOM::run
+class NucleusTable
+{
+  public:
+    void clear(void)
+    {
+        xS.clear();
+        yS.clear();
+        minHue.clear();
+        maxHue.clear();
+        minSat.clear();
+        maxSat.clear();
+        minBrt.clear();
+        maxBrt.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        xS.reserve(n);
+        yS.reserve(n);
+        minHue.reserve(n);
+        maxHue.reserve(n);
+        minSat.reserve(n);
+        maxSat.reserve(n);
+        minBrt.reserve(n);
+        maxBrt.reserve(n);
+    }
+
+    uint32_t add(int32_t x, int32_t y, double hueMin, double hueMax, double satMin, double satMax, double brtMin,
+                 double brtMax)
+    {
+        xS.push_back(x);
+        yS.push_back(y);
+        minHue.push_back(hueMin);
+        maxHue.push_back(hueMax);
+        minSat.push_back(satMin);
+        maxSat.push_back(satMax);
+        minBrt.push_back(brtMin);
+        maxBrt.push_back(brtMax);
+        return static_cast<uint32_t>(size() - 1);
+    }
+
+    size_t size() const
+    {
+        return xS.size();
+    }
+
+    std::vector<int32_t> xS, yS;
+    std::vector<double>  minHue, maxHue;
+    std::vector<double>  minSat, maxSat;
+    std::vector<double>  minBrt, maxBrt;
+};
@@ -0,0 +1,80 @@
+#include "PoissonDisc.h"
+
+#include <algorithm>
+#include <cmath>
+
+PoissonDisc::PoissonDisc(double w, double h, double minDistance, int attempts)
+  : width(w)
+  , height(h)
+  , radius(minDistance)
+  , cellSize(minDistance / sqrt(2.0))
+  , attempts(attempts)
+{
+    gridWidth  = static_cast<int32_t>(ceil(width / cellSize));
+    gridHeight = static_cast<int32_t>(ceil(height / cellSize));
+}
+
+bool PoissonDisc::fits(double x, double y) const
+{
+    if ((x < 0) || (y < 0) || (x >= width) || (y >= height))
+        return false;
+    int32_t gx = static_cast<int32_t>(x / cellSize);
+    int32_t gy = static_cast<int32_t>(y / cellSize);
+    for (int32_t cy = std::max(gy - 2, 0); cy <= std::min(gy + 2, gridHeight - 1); ++cy)
+    {
+        for (int32_t cx = std::max(gx - 2, 0); cx <= std::min(gx + 2, gridWidth - 1); ++cx)
+        {
+            int32_t idx = grid[cx + cy * gridWidth];
+            if (idx < 0)
+                continue;
+            double dx = points[idx].x - x;
+            double dy = points[idx].y - y;
+            if (dx * dx + dy * dy < radius * radius)
+                return false;
+        }
+    }
+    return true;
+}
+
+std::vector<PoissonDisc::POINT> PoissonDisc::sample(RandomGenerator &rnd, size_t maxPoints)
+{
+    points.clear();
+    grid.assign(static_cast<size_t>(gridWidth) * gridHeight, -1);
+    if (!maxPoints || (radius <= 0))
+        return points;
+
+    std::vector<int32_t> active;
+    auto                 insert = [&](double x, double y) {
+        grid[static_cast<int32_t>(x / cellSize) + static_cast<int32_t>(y / cellSize) * gridWidth] =
+            static_cast<int32_t>(points.size());
+        active.push_back(static_cast<int32_t>(points.size()));
+        points.push_back({x, y});
+    };
+
+    insert(rnd.GetUniformRange(0, width), rnd.GetUniformRange(0, height));
+    while (!active.empty() && (points.size() < maxPoints))
+    {
+        size_t a     = static_cast<size_t>(rnd.GetNormalizedUniformRange() * active.size());
+        POINT  p     = points[active[a]];
+        bool   found = false;
+        for (int k = 0; k < attempts; ++k)
+        { // candidate in the annulus between r and 2r
+            double angle = rnd.GetUniformRange(0, 2 * M_PI);
+            double dist  = rnd.GetUniformRange(radius, 2 * radius);
+            double x     = p.x + cos(angle) * dist;
+            double y     = p.y + sin(angle) * dist;
+            if (fits(x, y))
+            {
+                insert(x, y);
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            active[a] = active.back();
+            active.pop_back();
+        }
+    }
+    return points;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "RandomGenerator.h"
+
+// Bridson's poisson disc sampling, points keep at least minDistance to each other
+class PoissonDisc
+{
+  public:
+    typedef struct
+    {
+        double x;
+        double y;
+    } POINT;
+
+    PoissonDisc(double w, double h, double minDistance, int attempts = 30);
+
+    std::vector<POINT> sample(RandomGenerator &rnd, size_t maxPoints);
+
+  private:
+    bool fits(double x, double y) const;
+
+    double               width;
+    double               height;
+    double               radius;
+    double               cellSize;
+    int                  attempts;
+    int32_t              gridWidth;
+    int32_t              gridHeight;
+    std::vector<POINT>   points;
+    std::vector<int32_t> grid; // index into points, -1 if cell is free
+};
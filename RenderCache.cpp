@@ -0,0 +1,187 @@
+#include "RenderCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char *cacheVersion = "LabNew render cache 2";
+static const char *entrySuffix  = ".lab";
+
+static bool copyData(FILE *from, FILE *to)
+{
+    char   buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0)
+    {
+        if (fwrite(buffer, 1, n, to) != n)
+        {
+            return false;
+        }
+    }
+    return !ferror(from);
+}
+
+RenderCache::RenderCache(const std::string &folder, uint64_t maxBytes)
+  : folder(folder)
+  , maxBytes(maxBytes)
+{
+    if (!folder.empty())
+    {
+        mkdir(folder.c_str(), 0777);
+    }
+}
+
+std::string RenderCache::makeKey(const nlohmann::json &json, const std::string &seed, int32_t w, int32_t h)
+{
+    // dump() of a parsed object is canonical: keys are sorted, whitespace is dropped
+    std::string key(cacheVersion);
+    key += "\nseed=" + seed;
+    key += "\ncanvas=" + std::to_string(w) + "x" + std::to_string(h);
+    key += "\n" + json.dump();
+    return key;
+}
+
+uint64_t RenderCache::hash(const std::string &key)
+{ // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::string RenderCache::entryName(const std::string &key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash(key)));
+    return folder + "/" + name + entrySuffix;
+}
+
+bool RenderCache::fetch(const std::string &key, const std::string &rawFilename) const
+{
+    std::string entry = entryName(key);
+    FILE       *fp    = fopen(entry.c_str(), "rb");
+    if (!fp)
+    {
+        return false;
+    }
+    // header is the full key, so hash collisions are never served
+    uint32_t    keyLength = 0;
+    std::string storedKey;
+    if (fread(&keyLength, sizeof(keyLength), 1, fp) == 1 && keyLength == key.size())
+    {
+        storedKey.resize(keyLength);
+        if (fread(&storedKey[0], 1, keyLength, fp) != keyLength)
+        {
+            storedKey.clear();
+        }
+    }
+    if (storedKey != key)
+    {
+        fclose(fp);
+        return false;
+    }
+    FILE *out = fopen(rawFilename.c_str(), "wb");
+    bool  ok  = out && copyData(fp, out);
+    if (out)
+    {
+        ok = (fclose(out) == 0) && ok;
+    }
+    fclose(fp);
+    if (ok)
+    {
+        utimes(entry.c_str(), nullptr); // mtime is the LRU timestamp
+        printf("cache hit %s\n", entry.c_str());
+    }
+    return ok;
+}
+
+bool RenderCache::store(const std::string &key, const std::string &rawFilename) const
+{
+    std::string entry = entryName(key);
+    std::string temp  = entry + ".tmp" + std::to_string(getpid());
+    FILE       *in    = fopen(rawFilename.c_str(), "rb");
+    if (!in)
+    {
+        return false;
+    }
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+    uint32_t keyLength = key.size();
+    bool     ok        = (fwrite(&keyLength, sizeof(keyLength), 1, out) == 1) &&
+                  (fwrite(key.data(), 1, key.size(), out) == key.size()) && copyData(in, out);
+    ok = (fclose(out) == 0) && ok;
+    fclose(in);
+    if (!ok || rename(temp.c_str(), entry.c_str()) != 0)
+    {
+        unlink(temp.c_str());
+        printf("couldn't write cache entry %s\n", entry.c_str());
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void RenderCache::evict() const
+{
+    // one evicting process at a time, readers keep working on already opened entries
+    std::string lockName = folder + "/.lock";
+    int         lockFd   = open(lockName.c_str(), O_CREAT | O_RDWR, 0666);
+    if (lockFd < 0)
+    {
+        return;
+    }
+    flock(lockFd, LOCK_EX);
+
+    typedef struct
+    {
+        std::string name;
+        time_t      mtime;
+        uint64_t    size;
+    } ENTRY;
+    std::vector<ENTRY> entries;
+    uint64_t           total        = 0;
+    const size_t       suffixLength = strlen(entrySuffix);
+    if (DIR *dir = opendir(folder.c_str()))
+    {
+        while (struct dirent *de = readdir(dir))
+        {
+            std::string name(de->d_name);
+            if (name.size() <= suffixLength || name.compare(name.size() - suffixLength, suffixLength, entrySuffix))
+            {
+                continue;
+            }
+            struct stat st;
+            name = folder + "/" + name;
+            if (stat(name.c_str(), &st) == 0)
+            {
+                entries.push_back({name, st.st_mtime, static_cast<uint64_t>(st.st_size)});
+                total += st.st_size;
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(entries.begin(), entries.end(), [](const ENTRY &a, const ENTRY &b) { return a.mtime < b.mtime; });
+    for (size_t i = 0; (i < entries.size()) && (total > maxBytes); ++i)
+    {
+        unlink(entries[i].name.c_str()); // may already be gone, evicted by someone else before we got the lock
+        total -= entries[i].size;
+    }
+
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+}
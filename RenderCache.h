@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <json.hpp>
+
+// on disk cache of rendered raw canvases, keyed by a hash over config, seed and canvas geometry.
+// entries are written to a temp file and renamed into place, so several processes can share one folder.
+class RenderCache
+{
+  public:
+    RenderCache(const std::string &folder, uint64_t maxBytes);
+
+    static std::string makeKey(const nlohmann::json &json, const std::string &seed, int32_t w, int32_t h);
+
+    bool fetch(const std::string &key, const std::string &rawFilename) const;
+    bool store(const std::string &key, const std::string &rawFilename) const;
+
+  private:
+    static uint64_t hash(const std::string &key);
+    std::string     entryName(const std::string &key) const;
+    void            evict() const;
+
+    std::string folder;
+    uint64_t    maxBytes;
+};
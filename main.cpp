@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdio>
 #include <fstream>
@@ -9,7 +11,10 @@
 #include <json.hpp>
 
 #include "Canvas.h"
+#include "NucleusTable.h"
+#include "PoissonDisc.h"
 #include "RandomGenerator.h"
+#include "RenderCache.h"
 
 RandomGenerator rndg;
 
@@ -35,13 +40,8 @@ class Lab
     double minSatAdd = 2;
     double minBrtAdd = 3;
 
-    uint32_t activePoints = 1;
-
-    uint32_t pos = 0;
-    int32_t  xS[100], yS[100];
-    double   maxHue[100], minHue[100];
-    double   maxBrt[100], minBrt[100];
-    double   maxSat[100], minSat[100];
+    uint32_t     pos = 0;
+    NucleusTable nuclei;
 
     ATOM     atom;
     uint32_t lastrun     = 0;
@@ -52,10 +52,41 @@ class Lab
         int16_t x, y;
         int16_t dir; // direction to crystalize (referenced by dirPlus)
         int16_t len; // length to crystalize this run
-        int16_t set; // from which initial nucleus
+        int32_t set; // from which initial nucleus
     } RUNLIST;
 
     std::vector<RUNLIST> rl;
+    std::vector<int32_t> runLengths; // inverse cdf of the run length distribution
+
+    typedef std::array<uint8_t, sizeof(dirPlus) / sizeof(dirPlus[0])> PERMUTATION;
+
+    static const std::vector<PERMUTATION> &directionPermutations()
+    { // all orders of dirPlus, one uniform draw picks a shuffled order
+        static const std::vector<PERMUTATION> permutations = []() {
+            std::vector<PERMUTATION> all;
+            PERMUTATION              p;
+            for (size_t n = 0; n < p.size(); n++)
+            {
+                p[n] = n;
+            }
+            do
+            {
+                all.push_back(p);
+            } while (std::next_permutation(p.begin(), p.end()));
+            return all;
+        }();
+        return permutations;
+    }
+
+    void buildRunLengths()
+    { // len = minLength + u^2 * (maxLength - minLength), sampled at bucket centers
+        runLengths.resize(4096);
+        for (size_t n = 0; n < runLengths.size(); n++)
+        {
+            double u      = (n + 0.5) / runLengths.size();
+            runLengths[n] = minLength + u * u * static_cast<double>(maxLength - minLength);
+        }
+    }
 
   public:
     Canvas canvas;
@@ -112,12 +143,12 @@ class Lab
         nH = r + addr;
         nS = g + addg;
         nB = b + addb;
-        if ((maxHue[set] == 1.0) && (minHue[set] == 0.0))
-            torusValue(nH, minHue[set], maxHue[set]);
+        if ((nuclei.maxHue[set] == 1.0) && (nuclei.minHue[set] == 0.0))
+            torusValue(nH, nuclei.minHue[set], nuclei.maxHue[set]);
         else
-            clampValue(nH, minHue[set], maxHue[set]);
-        clampValue(nS, minSat[set], maxSat[set]);
-        clampValue(nB, minBrt[set], maxBrt[set]);
+            clampValue(nH, nuclei.minHue[set], nuclei.maxHue[set]);
+        clampValue(nS, nuclei.minSat[set], nuclei.maxSat[set]);
+        clampValue(nB, nuclei.minBrt[set], nuclei.maxBrt[set]);
         r = nH;
         g = nS;
         b = nB;
@@ -149,10 +180,13 @@ class Lab
         }
 
         if (itemsInList >= listSize() - 1)
-        {
-            printf("Too many items in list\n");
-            itemsInList = 0;
-            return;
+        { // dense configs: grow instead of dropping runners
+            size_t oldSize = listSize();
+            rl.resize(oldSize * 2);
+            for (size_t n = oldSize; n < listSize(); n++)
+            {
+                rl[n].x = -1;
+            }
         }
         if (pos < lastrun)
         {
@@ -163,6 +197,7 @@ class Lab
                 rl[n].y   = y;
                 rl[n].dir = dir;
                 rl[n].len = len;
+                rl[n].set = set;
                 ++itemsInList;
                 return;
             }
@@ -173,6 +208,7 @@ class Lab
         rl[n].y   = y;
         rl[n].dir = dir;
         rl[n].len = len;
+        rl[n].set = set;
         ++itemsInList;
         if (itemsInList > maximumListUsed)
         {
@@ -182,43 +218,30 @@ class Lab
 
     void GetNewRuns(int32_t x, int32_t y, int32_t set)
     {
-        uint32_t nR[maxDirections()];
-        ATOM     oAtom = atom;
         newRuns++;
-        for (uint32_t dir = 0; dir < maxDirections(); dir++)
+        uint32_t freeMask = canvas.freeNeighbours(x, y, dirPlus);
+        if (!freeMask)
         {
-            nR[dir] = dir;
-        }
-
-        for (uint32_t dir = 0; dir < maxDirections(); dir++)
-        { // shuffle directions index
-            int i   = rndg.GetNormalizedUniformRange() * maxDirections();
-            int a   = nR[dir];
-            nR[dir] = nR[i];
-            nR[i]   = a;
+            return;
         }
-        for (uint32_t d = 0; d < maxDirections(); d++)
+        const auto        &permutations = directionPermutations();
+        const PERMUTATION &order        = permutations[rndg.GetNormalizedUniformRange() * permutations.size()];
+        atom.cnt++;
+        const ATOM oAtom = atom;
+        for (uint32_t dir : order)
         {
-            uint32_t dir = nR[d];
-            ATOM     nAtom;
-            canvas.getValues(x + dirPlus[dir].x, y + dirPlus[dir].y, nAtom);
-            if (std::isnan(nAtom.hue))
+            if (!(freeMask & (1u << dir)))
+            {
+                continue;
+            }
+            if (!addOnStraight)
             {
                 atom = oAtom;
-                atom.cnt++;
-                if (!addOnStraight)
-                {
-                    addColor(atom.hue, atom.sat, atom.brt, rndg.GetUniformRange(minHueAdd, maxHueAdd),
-                             rndg.GetUniformRange(minSatAdd, maxSatAdd), rndg.GetUniformRange(minBrtAdd, maxBrtAdd),
-                             set);
-                }
-                auto nx = x + dirPlus[dir].x;
-                auto ny = y + dirPlus[dir].y;
-                auto r1 = pow(rndg.GetNormalizedUniformRange(), 2);
-                auto r2 = r1 * static_cast<double>(maxLength - minLength);
-                r2 += minLength;
-                addRunner(nx, ny, dir, (int32_t) r2, set);
+                addColor(atom.hue, atom.sat, atom.brt, rndg.GetUniformRange(minHueAdd, maxHueAdd),
+                         rndg.GetUniformRange(minSatAdd, maxSatAdd), rndg.GetUniformRange(minBrtAdd, maxBrtAdd), set);
             }
+            int32_t len = runLengths[rndg.GetNormalizedUniformRange() * runLengths.size()];
+            addRunner(x + dirPlus[dir].x, y + dirPlus[dir].y, dir, len, set);
         }
     }
 
@@ -250,7 +273,7 @@ class Lab
                     needsNewRun = false;
                     ATOM nAtom;
                     canvas.getValues(x, y, nAtom);
-                    if (!std::isnan(nAtom.hue))
+                    if (!Canvas::isEmpty(nAtom))
                     {
                         needsNewRun = true;
                     } // can't continue: split pathes
@@ -349,71 +372,96 @@ class Lab
         return 1;
     }
 
-    void ReadParams(nlohmann::json &json)
+    static int32_t ReadCoordinate(const nlohmann::json &point, const char *key, int32_t size)
     {
-        activePoints       = json["activePoints"].get<int>();
-        minHueAdd          = -1 * json["rangeHue"].get<double>();
-        maxHueAdd          = json["rangeHue"].get<double>() + json["biasHue"].get<double>();
-        minSatAdd          = -1 * json["rangeSat"].get<double>();
-        maxSatAdd          = json["rangeSat"].get<double>() + json["biasSat"].get<double>();
-        minBrtAdd          = -1 * json["rangeBrt"].get<double>();
-        maxBrtAdd          = json["rangeBrt"].get<double>() + json["biasBrt"].get<double>();
-        addOnStraight      = json["addOnStraight"].get<bool>();
-        minLength          = json["minLength"].get<int>();
-        maxLength          = json["maxLength"].get<int>();
-        shuffle            = json["shuffle"].get<int>();
-        garbageStart       = json["garbageStart"].get<int>();
-        crystalUndisturbed = json["crystalUndisturbed"].get<int>();
-
-        resetRuns();
-        canvas.clear();
-        for (uint32_t i = 0, t = 0; (i < activePoints) && (t < 1000); t++)
+        auto it = point.find(key);
+        if ((it != point.end()) && it->is_number())
         {
-            ATOM nAtom;
-            try
-            {
-                auto valx = json["points"][i]["x"].get<double>();
-                xS[i]     = valx * canvas.width();
-            }
-            catch (nlohmann::json::exception &e)
-            {
-                xS[i] = rndg.GetNormalizedUniformRange() * canvas.width();
-                xS[i] = xS[i] / 2 + canvas.width() / 4;
-            }
-            try
-            {
-                auto valy = json["points"][i]["y"].get<double>();
-                yS[i]     = valy * canvas.height();
-            }
-            catch (std::exception &e)
-            {
-                yS[i] = rndg.GetNormalizedUniformRange() * canvas.height();
-                yS[i] = yS[i] / 2 + canvas.height() / 4;
-            }
+            return it->get<double>() * size;
+        }
+        int32_t value = rndg.GetNormalizedUniformRange() * size; // no position given: somewhere in the center
+        return value / 2 + size / 4;
+    }
 
-            minHue[i] = json["points"][i]["hue"]["min"].get<double>();
-            maxHue[i] = json["points"][i]["hue"]["max"].get<double>();
+    static double ReadInit(const nlohmann::json &range)
+    {
+        auto it = range.find("init");
+        if (it != range.end())
+        {
+            return it->get<double>();
+        }
+        return rndg.GetUniformRange(range.at("min").get<double>(), range.at("max").get<double>());
+    }
 
-            minSat[i] = json["points"][i]["sat"]["min"].get<double>();
-            maxSat[i] = json["points"][i]["sat"]["max"].get<double>();
+    bool AddNucleus(int32_t x, int32_t y, const nlohmann::json &hue, const nlohmann::json &sat,
+                    const nlohmann::json &brt)
+    {
+        ATOM nAtom;
+        canvas.getValues(x, y, nAtom);
+        if (!Canvas::isEmpty(nAtom))
+        {
+            return false;
+        }
+        uint32_t set = nuclei.add(x, y, hue.at("min").get<double>(), hue.at("max").get<double>(),
+                                  sat.at("min").get<double>(), sat.at("max").get<double>(),
+                                  brt.at("min").get<double>(), brt.at("max").get<double>());
+        atom.hue = ReadInit(hue);
+        atom.sat = ReadInit(sat);
+        atom.brt = ReadInit(brt);
+        atom.run = set;
+        atom.cnt = 1;
+        canvas.setValues(x, y, atom);
+        GetNewRuns(x, y, set);
+        return true;
+    }
 
-            minBrt[i] = json["points"][i]["brt"]["min"].get<double>();
-            maxBrt[i] = json["points"][i]["brt"]["max"].get<double>();
-            printf("xy(%d)=[%d %d]\n", i, xS[i], yS[i]);
+    void ReadParams(nlohmann::json &json)
+    {
+        uint32_t activePoints = json.value("activePoints", 0);
+        minHueAdd             = -1 * json["rangeHue"].get<double>();
+        maxHueAdd             = json["rangeHue"].get<double>() + json["biasHue"].get<double>();
+        minSatAdd             = -1 * json["rangeSat"].get<double>();
+        maxSatAdd             = json["rangeSat"].get<double>() + json["biasSat"].get<double>();
+        minBrtAdd             = -1 * json["rangeBrt"].get<double>();
+        maxBrtAdd             = json["rangeBrt"].get<double>() + json["biasBrt"].get<double>();
+        addOnStraight         = json["addOnStraight"].get<bool>();
+        minLength             = json["minLength"].get<int>();
+        maxLength             = json["maxLength"].get<int>();
+        shuffle               = json["shuffle"].get<int>();
+        garbageStart          = json["garbageStart"].get<int>();
+        crystalUndisturbed    = json["crystalUndisturbed"].get<int>();
+        buildRunLengths();
+
+        resetRuns(); // canvas is cleared once by its constructor
+        nuclei.clear();
+        nuclei.reserve(activePoints);
+        for (uint32_t i = 0, t = 0; (i < activePoints) && (t < 1000 + activePoints); t++)
+        {
+            const nlohmann::json &point = json["points"].at(i);
 
-            canvas.getValues(xS[i], yS[i], nAtom);
-            if (std::isnan(nAtom.hue))
+            int32_t x = ReadCoordinate(point, "x", canvas.width());
+            int32_t y = ReadCoordinate(point, "y", canvas.height());
+            printf("xy(%d)=[%d %d]\n", i, x, y);
+            if (AddNucleus(x, y, point.at("hue"), point.at("sat"), point.at("brt")))
             {
-                atom.hue = json["points"][i]["hue"]["init"].get<double>();
-                atom.sat = json["points"][i]["sat"]["init"].get<double>();
-                atom.brt = json["points"][i]["brt"]["init"].get<double>();
-                atom.run = i;
-                atom.cnt = 1;
-                canvas.setValues(xS[i], yS[i], atom);
-                GetNewRuns(xS[i], yS[i], i);
                 i++;
             }
         }
+
+        auto poisson = json.find("poisson");
+        if (poisson != json.end())
+        { // procedural nuclei, minDistance is relative to the canvas width
+            const nlohmann::json &gen = *poisson;
+            PoissonDisc disc(canvas.width(), canvas.height(), gen.at("minDistance").get<double>() * canvas.width(),
+                             gen.value("attempts", 30));
+            auto samples = disc.sample(rndg, gen.value("count", 10000));
+            nuclei.reserve(nuclei.size() + samples.size());
+            for (const auto &p : samples)
+            {
+                AddNucleus(p.x, p.y, gen.at("hue"), gen.at("sat"), gen.at("brt"));
+            }
+        }
+        printf("nuclei: %zu\n", nuclei.size());
     }
 };
 
@@ -428,12 +476,17 @@ int main(int ac, char *av[])
         printf("-h,--height        height\n");
         printf("-s,--oversample    oversample factor (2,3,4)\n");
         printf("-r,--randseed      random seed value\n");
+        printf("-c,--cache         cache folder for rendered canvases\n");
+        printf("--cache-size       cache size limit in MB (default 4096)\n");
     }
     else
     {
         int         oversample = 1;
         std::string jsonFilename;
         std::string outputFilename("test.raw");
+        std::string cacheFolder;
+        uint64_t    cacheSize = 4096;
+        std::string seed("default");
         int         w = 3840, h = 2400;
         int         idxAc = 1;
         while (idxAc < ac)
@@ -461,7 +514,17 @@ int main(int ac, char *av[])
             }
             else if (item == "-r" || item == "--randseed")
             {
-                rndg.seed(::atoi(av[idxAc++]));
+                int sd = ::atoi(av[idxAc++]);
+                rndg.seed(sd);
+                seed = std::to_string(sd);
+            }
+            else if (item == "-c" || item == "--cache")
+            {
+                cacheFolder = av[idxAc++];
+            }
+            else if (item == "--cache-size")
+            {
+                cacheSize = ::atoll(av[idxAc++]);
             }
             else
             {
@@ -478,18 +541,29 @@ int main(int ac, char *av[])
         }
         nlohmann::json j;
         ifs >> j;
-        int ret = 0;
 
-        Lab lab(w * oversample, h * oversample);
-        lab.ReadParams(j);
-        do
-        {
-            ret = lab.crystallize();
-        } while (ret);
-        printf("Maximum list depth: %d\n", lab.maximumListUsed);
         std::stringstream ssRaw;
         ssRaw << outputFilename << ".raw";
-        lab.canvas.saveAsRaw(ssRaw.str().c_str());
+        // keyed on the oversampled canvas, so a cached canvas serves every output size mapping onto it
+        std::string key = RenderCache::makeKey(j, seed, w * oversample, h * oversample);
+        RenderCache cache(cacheFolder, cacheSize << 20);
+        if (cacheFolder.empty() || !cache.fetch(key, ssRaw.str()))
+        {
+            Lab lab(w * oversample, h * oversample);
+            lab.ReadParams(j);
+            int ret = 0;
+            do
+            {
+                ret = lab.crystallize();
+            } while (ret);
+            printf("Maximum list depth: %d\n", lab.maximumListUsed);
+            printf("New runs: %d\n", lab.newRuns);
+            lab.canvas.saveAsRaw(ssRaw.str().c_str());
+            if (!cacheFolder.empty())
+            {
+                cache.store(key, ssRaw.str());
+            }
+        }
         FILE *fp = fopen("to-jpeg.sh", "w");
         fprintf(fp, "#!/bin/bash\n");
         std::stringstream ss;
@@ -503,7 +577,6 @@ int main(int ac, char *av[])
         fprintf(fp, "xdg-open %s\n\n", ss.str().c_str());
         fclose(fp);
 
-        printf("New runs: %d\n", lab.newRuns);
         system("chmod +x ./to-jpeg.sh");
         system("./to-jpeg.sh");
     }